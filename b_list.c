@@ -1,20 +1,485 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "b_list.h"
 
+/* Links a node had before the live list changed them, visible to snapshots up to epoch `last` */
+typedef struct b_list_node_version {
+    struct b_list_node_version *older;
+    b_list_node *prev;
+    b_list_node *next;
+    unsigned long last;
+} b_list_node_version;
+
+/* Side table entry holding the saved links of one node, newest first */
+typedef struct {
+    b_list_node *node;
+    b_list_node_version *versions;
+} b_list_version_slot;
+
+/* Nodes the live list dropped during one epoch; snapshots older than that epoch may still reach them */
+typedef struct b_list_retired {
+    struct b_list_retired *next;
+    unsigned long epoch;
+    b_list_node *deleted;
+    b_list_node *detached;
+} b_list_retired;
+
+/* An epoch some snapshots are still reading, and how many of them */
+typedef struct {
+    unsigned long epoch;
+    unsigned int count;
+} b_list_live_epoch;
+
+/* State shared by a live list and its snapshots */
+typedef struct b_list_cow {
+    pthread_mutex_t lock;
+    unsigned long epoch;
+    unsigned int snapshots;
+    int live;
+    void (*free)(void *data);
+    b_list_version_slot *slots;
+    unsigned int slot_capacity;
+    unsigned int slot_count;
+    b_list_live_epoch *epochs;
+    unsigned int epoch_count;
+    unsigned int epoch_capacity;
+    b_list_retired *retired;
+    b_list_retired *retired_last;
+    b_list_node *orphans;
+    struct b_list_slabs *slabs;
+} b_list_cow;
+
+/* Chunk of nodes laid out in list order by b_list_defragment, freed once its last node is */
+typedef struct b_list_slab {
+    unsigned int live;
+    unsigned int count;
+    b_list_node nodes[];
+} b_list_slab;
+
+/* Chunks a list's nodes may live in, sorted by address */
+typedef struct b_list_slabs {
+    b_list_slab **slabs;
+    unsigned int count;
+    unsigned int capacity;
+} b_list_slabs;
+
+#define SLAB_NODES 256
+
+#define VIEW_BATCH 16
+
+/* Nodes a snapshot iterator resolved under its last lock acquisition */
+typedef struct b_list_view_batch {
+    unsigned int pos;
+    unsigned int len;
+    b_list_node *nodes[VIEW_BATCH];
+} b_list_view_batch;
+
+#define is_snapshot(list) ((list)->epoch != 0)
+
+#define PREFETCH_DISTANCE 4
+
+#if defined(__GNUC__)
+#define prefetch(addr) __builtin_prefetch(addr)
+#else
+#define prefetch(addr) ((void)(addr))
+#endif
+
+/* Find the chunk holding node, if any */
+static b_list_slab* slab_of(const b_list_slabs *slabs, const b_list_node *node, unsigned int *index) {
+    if (!slabs) return NULL;
+    unsigned int low = 0;
+    unsigned int high = slabs->count;
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        if ((uintptr_t)slabs->slabs[mid] <= (uintptr_t)node) low = mid + 1;
+        else high = mid;
+    }
+    if (!low) return NULL;
+    b_list_slab *slab = slabs->slabs[low - 1];
+    if ((uintptr_t)node >= (uintptr_t)(slab->nodes + slab->count)) return NULL;
+    if (index) *index = low - 1;
+    return slab;
+}
+
+static void node_free(b_list_slabs *slabs, b_list_node *node) {
+    unsigned int index;
+    b_list_slab *slab = slab_of(slabs, node, &index);
+    if (!slab) {
+        free(node);
+        return;
+    }
+    if (--slab->live) return;
+    memmove(&slabs->slabs[index], &slabs->slabs[index + 1], (--slabs->count - index) * sizeof(b_list_slab*));
+    free(slab);
+}
+
+static void slabs_destroy(b_list_slabs *slabs) {
+    if (!slabs) return;
+    for (unsigned int i = 0; i < slabs->count; i++) free(slabs->slabs[i]);
+    free(slabs->slabs);
+    free(slabs);
+}
+
+static int slab_compare(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(b_list_slab* const*)a;
+    uintptr_t y = (uintptr_t)*(b_list_slab* const*)b;
+    return (x > y) - (x < y);
+}
+
+#define step(node, direction) ((direction) == LIST_BEGIN ? (node)->next : (node)->prev)
+
+/* Start a lookahead cursor PREFETCH_DISTANCE nodes past node, prefetching on the way */
+static b_list_node* prefetch_ahead(b_list_node *node, b_list_iterator_direction direction) {
+    for (int i = 0; node && i < PREFETCH_DISTANCE; i++) {
+        node = step(node, direction);
+        if (node) prefetch(node);
+    }
+    return node;
+}
+
+/* Advance the lookahead cursor one node, whose memory was requested on the previous step */
+static b_list_node* prefetch_step(b_list_node *ahead, b_list_iterator_direction direction) {
+    if (!ahead) return NULL;
+    ahead = step(ahead, direction);
+    if (ahead) {
+        prefetch(step(ahead, direction));
+        prefetch(ahead->data);
+    }
+    return ahead;
+}
+
+static void cow_lock(b_list *list) {
+    if (list->cow) pthread_mutex_lock(&list->cow->lock);
+}
+
+static void cow_unlock(b_list *list) {
+    if (list->cow) pthread_mutex_unlock(&list->cow->lock);
+}
+
+static unsigned int slot_index(const b_list_cow *cow, const b_list_node *node) {
+    uintptr_t hash = (uintptr_t)node;
+    hash ^= hash >> 17;
+    hash *= (uintptr_t)0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 29;
+    return hash & (cow->slot_capacity - 1);
+}
+
+static b_list_version_slot* version_slot(const b_list_cow *cow, const b_list_node *node) {
+    if (!cow->slot_capacity) return NULL;
+    unsigned int i = slot_index(cow, node);
+    while (cow->slots[i].node) {
+        if (cow->slots[i].node == node) return &cow->slots[i];
+        i = (i + 1) & (cow->slot_capacity - 1);
+    }
+    return NULL;
+}
+
+/* Rehash the side table into capacity slots, dropping nodes without saved links */
+static int version_table_resize(b_list_cow *cow, unsigned int capacity) {
+    b_list_version_slot *old = cow->slots;
+    unsigned int old_capacity = cow->slot_capacity;
+    b_list_version_slot *slots = NULL;
+    if (capacity) {
+        slots = calloc(capacity, sizeof(b_list_version_slot));
+        if (!slots) return 0;
+    }
+    cow->slots = slots;
+    cow->slot_capacity = capacity;
+    cow->slot_count = 0;
+    for (unsigned int i = 0; i < old_capacity; i++) {
+        if (!old[i].versions) continue;
+        unsigned int j = slot_index(cow, old[i].node);
+        while (slots[j].node) j = (j + 1) & (capacity - 1);
+        slots[j] = old[i];
+        ++cow->slot_count;
+    }
+    free(old);
+    return 1;
+}
+
+static b_list_version_slot* version_slot_insert(b_list_cow *cow, b_list_node *node) {
+    b_list_version_slot *slot = version_slot(cow, node);
+    if (slot) return slot;
+    if ((cow->slot_count + 1) * 2 > cow->slot_capacity
+        && !version_table_resize(cow, cow->slot_capacity ? cow->slot_capacity * 2 : 64)) return NULL;
+    unsigned int i = slot_index(cow, node);
+    while (cow->slots[i].node) i = (i + 1) & (cow->slot_capacity - 1);
+    cow->slots[i].node = node;
+    cow->slots[i].versions = NULL;
+    ++cow->slot_count;
+    return &cow->slots[i];
+}
+
+/* Whether a live snapshot reads epoch in (low, high] */
+static int epoch_live_in(const b_list_cow *cow, unsigned long low, unsigned long high) {
+    for (unsigned int i = 0; i < cow->epoch_count; i++) {
+        if (cow->epochs[i].epoch > high) break;
+        if (cow->epochs[i].epoch > low) return 1;
+    }
+    return 0;
+}
+
+/* Save the links of a node the live list is about to change, if a snapshot can still see them */
+static int cow_preserve(b_list *list, b_list_node *node) {
+    b_list_cow *cow = list->cow;
+    if (!cow || !cow->snapshots || !node) return 1;
+    b_list_version_slot *slot = version_slot_insert(cow, node);
+    if (!slot) return 0;
+    if (slot->versions && slot->versions->last == cow->epoch - 1) return 1;
+    b_list_node_version *version = malloc(sizeof(b_list_node_version));
+    if (!version) return 0;
+    version->prev = node->prev;
+    version->next = node->next;
+    version->last = cow->epoch - 1;
+    version->older = slot->versions;
+    slot->versions = version;
+    return 1;
+}
+
+/* Make sure the current epoch has a retirement batch, so retiring a node cannot fail */
+static int cow_reserve_retired(b_list *list) {
+    b_list_cow *cow = list->cow;
+    if (!cow || !cow->snapshots) return 1;
+    if (cow->retired_last && cow->retired_last->epoch == cow->epoch) return 1;
+    b_list_retired *batch = calloc(1, sizeof(b_list_retired));
+    if (!batch) return 0;
+    batch->epoch = cow->epoch;
+    if (cow->retired_last) cow->retired_last->next = batch;
+    else cow->retired = batch;
+    cow->retired_last = batch;
+    return 1;
+}
+
+static void free_chain(b_list_slabs *slabs, b_list_node *node, void (*free_data)(void *data)) {
+    b_list_node *next;
+    while (node) {
+        if (free_data) free_data(node->data);
+        next = node->next;
+        node_free(slabs, node);
+        node = next;
+    }
+}
+
+/* Drop saved links and retired nodes no live snapshot can reach any more, called with the lock held */
+static void cow_prune(b_list_cow *cow) {
+    while (cow->retired && (!cow->epoch_count || cow->epochs[0].epoch >= cow->retired->epoch)) {
+        b_list_retired *batch = cow->retired;
+        free_chain(cow->slabs, batch->deleted, cow->free);
+        free_chain(cow->slabs, batch->detached, NULL);
+        cow->retired = batch->next;
+        free(batch);
+    }
+    if (!cow->retired) cow->retired_last = NULL;
+    unsigned int used = 0;
+    for (unsigned int i = 0; i < cow->slot_capacity; i++) {
+        b_list_node_version **link = &cow->slots[i].versions;
+        while (*link) {
+            b_list_node_version *version = *link;
+            unsigned long low = version->older ? version->older->last : 0;
+            if (epoch_live_in(cow, low, version->last)) link = &version->older;
+            else {
+                *link = version->older;
+                free(version);
+            }
+        }
+        used += cow->slots[i].versions != NULL;
+    }
+    unsigned int capacity = 0;
+    if (used) for (capacity = 64; capacity < used * 2; capacity *= 2);
+    if (capacity != cow->slot_capacity || used != cow->slot_count) version_table_resize(cow, capacity);
+    if (!cow->snapshots) {
+        free_chain(cow->slabs, cow->orphans, cow->free);
+        cow->orphans = NULL;
+    }
+}
+
+static void cow_destroy(b_list_cow *cow) {
+    pthread_mutex_destroy(&cow->lock);
+    free(cow->slots);
+    free(cow->epochs);
+    free(cow);
+}
+
+/* Hand a node the live list no longer references over to the snapshots that can still see it */
+static void cow_retire(b_list *list, b_list_node *node) {
+    if (list->cow && list->cow->snapshots) {
+        b_list_retired *batch = list->cow->retired_last;
+        node->next = batch->deleted;
+        batch->deleted = node;
+        return;
+    }
+    if (list->free) list->free(node->data);
+    node_free(list->slabs, node);
+}
+
+/* Swap a node being popped for a heap copy the caller owns, when snapshots or a chunk still hold the original */
+static b_list_node* detach_node(b_list *list, b_list_node *node, b_list_node *copy) {
+    if (!copy) return node;
+    copy->data = node->data;
+    if (list->cow && list->cow->snapshots) {
+        b_list_retired *batch = list->cow->retired_last;
+        node->next = batch->detached;
+        batch->detached = node;
+    } else node_free(list->slabs, node);
+    return copy;
+}
+
+/* Follow a node's link as a snapshot sees it, called with the lock held */
+static b_list_node* snapshot_link(const b_list *list, b_list_node *node, b_list_iterator_direction direction) {
+    b_list_node *prev = node->prev;
+    b_list_node *next = node->next;
+    b_list_version_slot *slot = version_slot(list->cow, node);
+    b_list_node_version *version;
+    for (version = slot ? slot->versions : NULL; version && version->last >= list->epoch; version = version->older) {
+        prev = version->prev;
+        next = version->next;
+    }
+    return direction == LIST_BEGIN ? next : prev;
+}
+
+/* Collect up to max nodes following node as the list sees them, taking a snapshot's lock once */
+static unsigned int view_walk(const b_list *list, b_list_node *node, b_list_iterator_direction direction, b_list_node **out, unsigned int max) {
+    unsigned int count = 0;
+    if (!is_snapshot(list)) {
+        while (count < max && (node = direction == LIST_BEGIN ? node->next : node->prev)) out[count++] = node;
+        return count;
+    }
+    pthread_mutex_lock(&list->cow->lock);
+    while (count < max && (node = snapshot_link(list, node, direction))) out[count++] = node;
+    pthread_mutex_unlock(&list->cow->lock);
+    return count;
+}
+
+/* Walk steps nodes forward from node as the list sees them, taking a snapshot's lock once */
+static b_list_node* view_skip(const b_list *list, b_list_node *node, int steps) {
+    if (!is_snapshot(list)) {
+        while (--steps >= 0) node = node->next;
+        return node;
+    }
+    pthread_mutex_lock(&list->cow->lock);
+    while (--steps >= 0) node = snapshot_link(list, node, LIST_BEGIN);
+    pthread_mutex_unlock(&list->cow->lock);
+    return node;
+}
+
+static int iterator_init(b_list_iterator *it, b_list *list, b_list_node *node, b_list_iterator_direction direction) {
+    it->next = node;
+    it->direction = direction == LIST_BEGIN ? LIST_BEGIN : LIST_END;
+    it->view = list && is_snapshot(list) ? list : NULL;
+    it->batch = NULL;
+    it->ahead = NULL;
+    if (!it->view) {
+        it->ahead = prefetch_ahead(node, it->direction);
+        return 1;
+    }
+    it->batch = calloc(1, sizeof(b_list_view_batch));
+    return it->batch != NULL;
+}
+
+static void release_snapshot(b_list *list) {
+    b_list_cow *cow = list->cow;
+    pthread_mutex_lock(&cow->lock);
+    unsigned int i = 0;
+    while (cow->epochs[i].epoch != list->epoch) i++;
+    if (--cow->epochs[i].count == 0) {
+        --cow->epoch_count;
+        for (; i < cow->epoch_count; i++) cow->epochs[i] = cow->epochs[i + 1];
+    }
+    --cow->snapshots;
+    cow_prune(cow);
+    int orphaned = !cow->snapshots && !cow->live;
+    pthread_mutex_unlock(&cow->lock);
+    if (orphaned) {
+        slabs_destroy(cow->slabs);
+        cow_destroy(cow);
+    }
+    free(list);
+}
+
 void b_free_list(b_list *list) {
     if (!list) return;
+    if (is_snapshot(list)) {
+        release_snapshot(list);
+        return;
+    }
+    b_list_cow *cow = list->cow;
+    if (cow) {
+        pthread_mutex_lock(&cow->lock);
+        if (cow->snapshots) {
+            // The snapshots take over the nodes and the chunks they live in
+            cow->orphans = list->head;
+            list->head = list->tail = NULL;
+            list->slabs = NULL;
+        }
+        cow->live = 0;
+        int orphaned = !cow->snapshots;
+        if (orphaned) cow_prune(cow);
+        pthread_mutex_unlock(&cow->lock);
+        if (orphaned) cow_destroy(cow);
+    }
     b_list_node *node = list->head;
+    b_list_node *ahead = prefetch_ahead(node, LIST_BEGIN);
     b_list_node *next;
     while (node) {
+        ahead = prefetch_step(ahead, LIST_BEGIN);
         if (list->free) list->free(node->data);
         next = node->next;
-        free(node);
+        node_free(list->slabs, node);
         node = next;
     } 
+    slabs_destroy(list->slabs);
     free(list);
 }
 
+b_list* b_list_snapshot(b_list *list) {
+    if (!list) return NULL;
+    b_list *snapshot = malloc(sizeof(b_list));
+    if (!snapshot) return NULL;
+    if (!list->cow) {
+        b_list_cow *cow = calloc(1, sizeof(b_list_cow));
+        if (!cow || pthread_mutex_init(&cow->lock, NULL)) {
+            free(cow);
+            free(snapshot);
+            return NULL;
+        }
+        cow->epoch = 1;
+        cow->live = 1;
+        cow->free = list->free;
+        cow->slabs = list->slabs;
+        list->cow = cow;
+    }
+    b_list_cow *cow = list->cow;
+    pthread_mutex_lock(&cow->lock);
+    *snapshot = *list;
+    if (is_snapshot(list)) {
+        unsigned int i = 0;
+        while (cow->epochs[i].epoch != list->epoch) i++;
+        ++cow->epochs[i].count;
+    } else {
+        if (cow->epoch_count == cow->epoch_capacity) {
+            unsigned int capacity = cow->epoch_capacity ? cow->epoch_capacity * 2 : 4;
+            b_list_live_epoch *epochs = realloc(cow->epochs, capacity * sizeof(b_list_live_epoch));
+            if (!epochs) {
+                pthread_mutex_unlock(&cow->lock);
+                free(snapshot);
+                return NULL;
+            }
+            cow->epochs = epochs;
+            cow->epoch_capacity = capacity;
+        }
+        snapshot->epoch = cow->epoch++;
+        cow->epochs[cow->epoch_count].epoch = snapshot->epoch;
+        cow->epochs[cow->epoch_count++].count = 1;
+    }
+    ++cow->snapshots;
+    pthread_mutex_unlock(&cow->lock);
+    return snapshot;
+}
+
 b_list_node* b_new_list_node(void *data) {
     b_list_node *node = malloc(sizeof(b_list_node));
     if (!node) return NULL;
@@ -37,11 +502,19 @@ b_list* b_new_list_with_func(void (*free)(void *data)) {
     list->head = NULL;
     list->tail = NULL;
     list->size = 0;
+    list->cow = NULL;
+    list->epoch = 0;
+    list->slabs = NULL;
     return list;
 }
 
 b_list_node* b_list_lpush(b_list *list, b_list_node *node) {
-    if (!list || !node) return NULL;
+    if (!list || !node || is_snapshot(list)) return NULL;
+    cow_lock(list);
+    if (!cow_preserve(list, list->head)) {
+        cow_unlock(list);
+        return NULL;
+    }
     node->next = node->prev = NULL;
     if (!list->size) list->head = list->tail = node;
     else {
@@ -50,11 +523,17 @@ b_list_node* b_list_lpush(b_list *list, b_list_node *node) {
         list->head = node;
     }
     list->size += 1;
+    cow_unlock(list);
     return node;
 }
 
 b_list_node* b_list_rpush(b_list *list, b_list_node *node) {
-    if (!list || !node) return NULL;
+    if (!list || !node || is_snapshot(list)) return NULL;
+    cow_lock(list);
+    if (!cow_preserve(list, list->tail)) {
+        cow_unlock(list);
+        return NULL;
+    }
     node->next = node->prev = NULL;
     if (!list->size) list->head = list->tail = node;
     else {
@@ -63,75 +542,119 @@ b_list_node* b_list_rpush(b_list *list, b_list_node *node) {
         list->tail = node;
     }
     list->size += 1;
+    cow_unlock(list);
     return node;
 }
 
 b_list_node* b_list_rpop(b_list *list) {
-    if (!list || !list->size) return NULL;
+    if (!list || !list->size || is_snapshot(list)) return NULL;
+    cow_lock(list);
     b_list_node *node = list->tail;
+    int keep = (list->cow && list->cow->snapshots) || slab_of(list->slabs, node, NULL);
+    b_list_node *copy = keep ? b_new_list_node(NULL) : NULL;
+    if ((keep && !copy)
+        || !cow_preserve(list, node) || !cow_preserve(list, node->prev) || !cow_reserve_retired(list)) {
+        free(copy);
+        cow_unlock(list);
+        errno = ENOMEM;
+        return NULL;
+    }
     if (list->size-- == 1) list->head = list->tail = NULL;
     else {
         (list->tail = node->prev)->next = NULL;
         node->prev = node->next = NULL;
     }
+    node = detach_node(list, node, copy);
+    cow_unlock(list);
     return node;
 }
 
 b_list_node* b_list_lpop(b_list *list) {
-    if (!list || !list->size) return NULL;
+    if (!list || !list->size || is_snapshot(list)) return NULL;
+    cow_lock(list);
     b_list_node *node = list->head;
+    int keep = (list->cow && list->cow->snapshots) || slab_of(list->slabs, node, NULL);
+    b_list_node *copy = keep ? b_new_list_node(NULL) : NULL;
+    if ((keep && !copy)
+        || !cow_preserve(list, node) || !cow_preserve(list, node->next) || !cow_reserve_retired(list)) {
+        free(copy);
+        cow_unlock(list);
+        errno = ENOMEM;
+        return NULL;
+    }
     if (list->size-- == 1) list->head = list->tail = NULL;
     else {
         (list->head = node->next)->prev = NULL;
         node->prev = node->next = NULL;
     }
+    node = detach_node(list, node, copy);
+    cow_unlock(list);
     return node;
 }
 
 b_list_node* b_list_fetch(b_list *list, int index) {
     if (!list || !list->size || index < 0 || index >= list->size) return NULL;
-    b_list_node *node = list->head;
-    while (--index >= 0) node = node->next;
-    return node;
+    return view_skip(list, list->head, index);
 }
 
 b_list_node* b_list_find(b_list *list, int (*match)(void *a, void *b), void *data) {
     if (!list) return NULL;
-    b_list_node *node = list->head;
-    while (node && !match(node->data, data)) node = node->next;
+    b_list_node *node;
+    if (is_snapshot(list)) {
+        b_list_iterator it;
+        if (!iterator_init(&it, list, list->head, LIST_BEGIN)) return NULL;
+        while ((node = b_list_iterator_next(&it)) && !match(node->data, data));
+        free(it.batch);
+        return node;
+    }
+    node = list->head;
+    b_list_node *ahead = prefetch_ahead(node, LIST_BEGIN);
+    while (node && !match(node->data, data)) {
+        ahead = prefetch_step(ahead, LIST_BEGIN);
+        node = node->next;
+    }
     return node;
 }
 
 b_list_node* b_list_insert(b_list *list, b_list_node *new_node, int index) {
-    if (!list || !new_node || index < 0 || index > list->size) return NULL;
-    new_node->next = new_node->prev = NULL;
-    if (!list->size) list->head = list->tail = new_node;
-    else if (index == 0) {
-        new_node->next = list->head;
-        list->head = list->head->prev = new_node;
-    } else if (index == list->size) {
-        new_node->prev = list->tail;
-        list->tail = list->tail->next = new_node;
-    } else {
-        b_list_node *node = list->head;
-        while (--index >= 0) node = node->next;
-        new_node->next = node;
-        new_node->prev = node->prev;
-        node->prev = node->prev->next = new_node;
+    if (!list || !new_node || index < 0 || index > list->size || is_snapshot(list)) return NULL;
+    cow_lock(list);
+    b_list_node *next = NULL;
+    if (index < list->size) {
+        next = list->head;
+        while (--index >= 0) next = next->next;
     }
+    b_list_node *prev = next ? next->prev : list->tail;
+    if (!cow_preserve(list, prev) || !cow_preserve(list, next)) {
+        cow_unlock(list);
+        return NULL;
+    }
+    new_node->prev = prev;
+    new_node->next = next;
+    if (prev) prev->next = new_node;
+    else list->head = new_node;
+    if (next) next->prev = new_node;
+    else list->tail = new_node;
     ++list->size;
+    cow_unlock(list);
     return new_node;
 }
 
 void b_list_delete(b_list *list, b_list_node *node) {
-    if (!list || !node) return; 
+    if (!list || !node || is_snapshot(list)) return; 
+    cow_lock(list);
+    if (!cow_preserve(list, node) || !cow_preserve(list, node->prev) || !cow_preserve(list, node->next)
+        || !cow_reserve_retired(list)) {
+        cow_unlock(list);
+        return;
+    }
     if (node->prev) node->prev->next = node->next;
     else list->head = node->next;
     if (node->next) node->next->prev = node->prev;
     else list->tail = node->prev;
-    if (list->free) list->free(node->data);
     --list->size;
-    free(node);
+    cow_retire(list, node);
+    cow_unlock(list);
 }
 
 void b_list_delete_at(b_list *list, int index) {
@@ -141,15 +664,13 @@ void b_list_delete_at(b_list *list, int index) {
     else {
         b_list_node* node = list->head;
         while (--index >= 0) node = node->next;
-        node->prev->next = node->next;
-        node->next->prev = node->prev;
-        --list->size;
-        free(node);
+        b_list_delete(list, node);
     }
 }
 
 void b_free_list_iterator(b_list_iterator *it) {
     if (!it) return;
+    free(it->batch);
     free(it);
 }
 
@@ -157,8 +678,10 @@ b_list_iterator* b_new_list_iterator(b_list *list, b_list_iterator_direction dir
     if (!list) return NULL;
     b_list_iterator* it = malloc(sizeof(b_list_iterator));
     if (!it) return NULL;
-    it->next = direction == LIST_BEGIN ? list->head : list->tail;
-    it->direction = direction == LIST_BEGIN ? LIST_BEGIN : LIST_END;
+    if (!iterator_init(it, list, direction == LIST_BEGIN ? list->head : list->tail, direction)) {
+        free(it);
+        return NULL;
+    }
     return it;
 }
 
@@ -166,8 +689,18 @@ b_list_iterator* b_new_list_iterator_from_node(b_list_node *node, b_list_iterato
     if (!node) return NULL;
     b_list_iterator* it = malloc(sizeof(b_list_iterator));
     if (!it) return NULL;
-    it->next = node;
-    it->direction = direction == LIST_BEGIN ? LIST_BEGIN : LIST_END;
+    iterator_init(it, NULL, node, direction);
+    return it;
+}
+
+b_list_iterator* b_new_list_iterator_from_node_in(b_list *list, b_list_node *node, b_list_iterator_direction direction) {
+    if (!list || !node) return NULL;
+    b_list_iterator* it = malloc(sizeof(b_list_iterator));
+    if (!it) return NULL;
+    if (!iterator_init(it, list, node, direction)) {
+        free(it);
+        return NULL;
+    }
     return it;
 }
 
@@ -175,21 +708,27 @@ b_list_iterator* b_new_list_iterator_from_index(b_list *list, int index, b_list_
     if (!list || index < 0 || index >= list->size) return NULL;
     b_list_iterator *it = malloc(sizeof(b_list_iterator));
     if (!it) return NULL;
-    it->direction = direction == LIST_BEGIN ? LIST_BEGIN : LIST_END;
-    if (index == list->size) {
-        it->next = list->tail;
-    } else {
-        b_list_node *node = list->head;
-        while (--index >= 0) node = node->next;
-        it->next = node;
+    if (!iterator_init(it, list, view_skip(list, list->head, index), direction)) {
+        free(it);
+        return NULL;
     }
     return it;
 }
 
 b_list_node* b_list_iterator_next(b_list_iterator *it) {
-    if (!it) return NULL;
+    if (!it || !it->next) return NULL;
     b_list_node* node = it->next;
-    it->next = it->direction == LIST_BEGIN ? node->next : node->prev;
+    if (!it->view) {
+        it->next = step(node, it->direction);
+        it->ahead = prefetch_step(it->ahead, it->direction);
+        return node;
+    }
+    b_list_view_batch *batch = it->batch;
+    if (batch->pos == batch->len) {
+        batch->len = view_walk(it->view, node, it->direction, batch->nodes, VIEW_BATCH);
+        batch->pos = 0;
+    }
+    it->next = batch->pos < batch->len ? batch->nodes[batch->pos++] : NULL;
     return node;
 }
 
@@ -199,14 +738,18 @@ static void merge(b_list_node **l1, b_list_node **l2, b_list_node **tail_ref, in
     b_list_node *left = *l1;
     b_list_node *right = *l2;
     b_list_node *prev = NULL;
+    b_list_node *left_ahead = prefetch_ahead(left, LIST_BEGIN);
+    b_list_node *right_ahead = prefetch_ahead(right, LIST_BEGIN);
     while (left && right) {
         int comp = compare(left->data, right->data);
         if (comp <= 0) {
             node->next = left;
             left = left->next;
+            left_ahead = prefetch_step(left_ahead, LIST_BEGIN);
         } else {
             node->next = right;
             right = right->next;
+            right_ahead = prefetch_step(right_ahead, LIST_BEGIN);
         }
         node = node->next;
         node->prev = prev;
@@ -243,7 +786,74 @@ static void merge_sort(b_list_node **head_ref, b_list_node **tail_ref, int (*com
 }
 
 void b_list_sort(b_list *list, int (*compare)(void *a, void *b)) {
-    if (!list || list->size <= 1) return;
-    
+    if (!list || list->size <= 1 || is_snapshot(list)) return;
+    cow_lock(list);
+    b_list_node *node;
+    for (node = list->head; node; node = node->next) {
+        if (!cow_preserve(list, node)) {
+            cow_unlock(list);
+            return;
+        }
+    }
     merge_sort(&list->head, &list->tail, compare);
+    cow_unlock(list);
+}
+
+static int defragment(b_list *list) {
+    unsigned int chunks = (list->size + SLAB_NODES - 1) / SLAB_NODES;
+    if (!list->slabs) {
+        list->slabs = calloc(1, sizeof(b_list_slabs));
+        if (!list->slabs) return 0;
+        if (list->cow) list->cow->slabs = list->slabs;
+    }
+    b_list_slabs *slabs = list->slabs;
+    if (slabs->count + chunks > slabs->capacity) {
+        b_list_slab **grown = realloc(slabs->slabs, (slabs->count + chunks) * sizeof(b_list_slab*));
+        if (!grown) return 0;
+        slabs->slabs = grown;
+        slabs->capacity = slabs->count + chunks;
+    }
+    b_list_slab **fresh = malloc(chunks * sizeof(b_list_slab*));
+    if (!fresh) return 0;
+    for (unsigned int i = 0; i < chunks; i++) {
+        unsigned int count = i + 1 < chunks ? SLAB_NODES : list->size - i * SLAB_NODES;
+        fresh[i] = malloc(sizeof(b_list_slab) + count * sizeof(b_list_node));
+        if (!fresh[i]) {
+            while (i--) free(fresh[i]);
+            free(fresh);
+            return 0;
+        }
+        fresh[i]->live = fresh[i]->count = count;
+        slabs->slabs[slabs->count + i] = fresh[i];
+    }
+    slabs->count += chunks;
+    qsort(slabs->slabs, slabs->count, sizeof(b_list_slab*), slab_compare);
+    b_list_node *old = list->head;
+    b_list_node *ahead = prefetch_ahead(old, LIST_BEGIN);
+    b_list_node *prev = NULL;
+    b_list_node *next;
+    for (unsigned int i = 0; i < list->size; i++) {
+        b_list_node *node = &fresh[i / SLAB_NODES]->nodes[i % SLAB_NODES];
+        node->data = old->data;
+        node->prev = prev;
+        if (prev) prev->next = node;
+        else list->head = node;
+        prev = node;
+        ahead = prefetch_step(ahead, LIST_BEGIN);
+        next = old->next;
+        node_free(slabs, old);
+        old = next;
+    }
+    prev->next = NULL;
+    list->tail = prev;
+    free(fresh);
+    return 1;
+}
+
+int b_list_defragment(b_list *list) {
+    if (!list || is_snapshot(list)) return 0;
+    cow_lock(list);
+    int done = !(list->cow && list->cow->snapshots) && (!list->size || defragment(list));
+    cow_unlock(list);
+    return done;
 }
@@ -3,6 +3,9 @@
 
 #include <stdlib.h>
 
+struct b_list_cow;
+struct b_list_slabs;
+
 typedef struct b_list_node {
     struct b_list_node *prev;
     struct b_list_node *next;
@@ -14,6 +17,9 @@ typedef struct {
     b_list_node *tail;
     unsigned int size;
     void (*free)(void *data);
+    struct b_list_cow *cow;
+    unsigned long epoch;
+    struct b_list_slabs *slabs;
 } b_list;
 
 typedef enum {
@@ -21,9 +27,14 @@ typedef enum {
     LIST_END
 } b_list_iterator_direction;
 
+struct b_list_view_batch;
+
 typedef struct {
     b_list_node *next;
     b_list_iterator_direction direction;
+    const b_list *view;
+    struct b_list_view_batch *batch;
+    b_list_node *ahead;
 } b_list_iterator;
 
 b_list_node* b_new_list_node(void *data);
@@ -36,6 +47,16 @@ b_list* b_new_list_with_func(void (*free)(void *));
 b_list_node* b_list_rpush(b_list *list, b_list_node *node);
 b_list_node* b_list_lpush(b_list *list, b_list_node *node);
 
+/**
+ * Detach and return the last / first node, which the caller may always free().
+ * If snapshots of the list are alive, or the node sits in a chunk made by
+ * b_list_defragment, the result is a heap copy holding the same data: it is not
+ * the pointer that was pushed, and the list frees the original node itself once
+ * nothing needs it. Data popped while snapshots are alive is still read by them.
+ * Returns NULL for an empty list. Making the copy can fail: then NULL is returned
+ * with errno set to ENOMEM and the list left unchanged (list->size stays non-zero),
+ * so drain loops that must not stop early should check list->size as well
+*/
 b_list_node* b_list_rpop(b_list *list);
 b_list_node* b_list_lpop(b_list *list);
 
@@ -49,11 +70,43 @@ void b_list_delete_at(b_list *list, int index);
 
 void b_free_list(b_list *list);
 
+/**
+ * Take a read-only, point-in-time snapshot of the list in O(1).
+ * The snapshot shares nodes with the live list; the old links of a node are
+ * only copied when the live list modifies it. Walk the snapshot with the
+ * iterator, fetch or find functions (not node->next / node->prev directly)
+ * and release it with b_free_list. Nodes deleted or popped from the live list
+ * are kept, deleted ones along with their data, only until every snapshot that
+ * can still reach them is released.
+*/
+b_list* b_list_snapshot(b_list *list);
+
 void b_list_sort(b_list *list, int (*compare)(void *a, void *b));
 
+/**
+ * Move the nodes into contiguous chunks of 256 in list order so traversal walks memory sequentially.
+ * Every node pointer previously taken from the list is invalidated; fetch them again afterwards.
+ * The list keeps ownership of chunked nodes: b_list_lpop / b_list_rpop hand out heap copies of them,
+ * and a chunk stays allocated until its last node is deleted, so at worst each surviving node
+ * holds on to 256 nodes' worth of memory.
+ * Returns 1 on success, or 0, leaving the list untouched, if allocation fails or snapshots of the list are alive
+*/
+int b_list_defragment(b_list *list);
+
 b_list_iterator* b_new_list_iterator(b_list *list, b_list_iterator_direction direction);
+/**
+ * Iterate from a node along the live links; use b_new_list_iterator_from_node_in for nodes of a snapshot
+*/
 b_list_iterator* b_new_list_iterator_from_node(b_list_node *node, b_list_iterator_direction direction);
+/**
+ * Iterate from a node of the given list or snapshot, following the links that list sees
+*/
+b_list_iterator* b_new_list_iterator_from_node_in(b_list *list, b_list_node *node, b_list_iterator_direction direction);
 b_list_iterator* b_new_list_iterator_from_index(b_list *list, int index, b_list_iterator_direction direction); 
+/**
+ * Live-list iterators prefetch a few nodes ahead, so apart from the node just returned
+ * no node may be deleted from the list while the iterator is in use
+*/
 b_list_node* b_list_iterator_next(b_list_iterator *it); 
 void b_free_list_iterator(b_list_iterator *it);
 
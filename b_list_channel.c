@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "b_list_channel.h"
+
+static int channel_open(b_list_channel *channel) {
+#ifdef __linux__
+    channel->fds[0] = channel->fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return channel->fds[0] >= 0;
+#else
+    if (pipe(channel->fds)) return 0;
+    for (int i = 0; i < 2; i++) {
+        fcntl(channel->fds[i], F_SETFL, fcntl(channel->fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(channel->fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return 1;
+#endif
+}
+
+static void channel_close(b_list_channel *channel) {
+    close(channel->fds[0]);
+    if (channel->fds[1] != channel->fds[0]) close(channel->fds[1]);
+}
+
+/* A full counter or pipe already reads as ready, so EAGAIN is not an error */
+static void channel_signal(b_list_channel *channel) {
+#ifdef __linux__
+    uint64_t one = 1;
+    while (write(channel->fds[1], &one, sizeof(one)) < 0 && errno == EINTR);
+#else
+    char one = 1;
+    while (write(channel->fds[1], &one, sizeof(one)) < 0 && errno == EINTR);
+#endif
+}
+
+static void channel_clear(b_list_channel *channel) {
+#ifdef __linux__
+    uint64_t count;
+    while (read(channel->fds[0], &count, sizeof(count)) < 0 && errno == EINTR);
+#else
+    char buffer[64];
+    ssize_t n;
+    while ((n = read(channel->fds[0], buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR));
+#endif
+}
+
+b_list_channel* b_new_list_channel(void (*free)(void *data)) {
+    b_list_channel *channel = malloc(sizeof(b_list_channel));
+    if (!channel) return NULL;
+    channel->queue = b_new_list_with_func(free);
+    channel->incoming = NULL;
+    if (!channel->queue || !channel_open(channel)) {
+        b_free_list(channel->queue);
+        free(channel);
+        return NULL;
+    }
+    return channel;
+}
+
+int b_list_channel_fd(b_list_channel *channel) {
+    if (!channel) return -1;
+    return channel->fds[0];
+}
+
+b_list_node* b_list_channel_push(b_list_channel *channel, b_list_node *node) {
+    if (!channel || !node) return NULL;
+    node->prev = NULL;
+    b_list_node *head = __atomic_load_n(&channel->incoming, __ATOMIC_RELAXED);
+    do {
+        node->next = head;
+    } while (!__atomic_compare_exchange_n(&channel->incoming, &head, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    // Only the push that finds the stack empty wakes the consumer
+    if (!head) channel_signal(channel);
+    return node;
+}
+
+unsigned int b_list_channel_drain(b_list_channel *channel, b_list *out, unsigned int max) {
+    if (!channel || !out) return 0;
+    // Clear before taking the stack so a push racing with us re-signals instead of being missed
+    channel_clear(channel);
+    b_list_node *node = __atomic_exchange_n(&channel->incoming, NULL, __ATOMIC_ACQUIRE);
+    b_list_node *fifo = NULL;
+    b_list_node *next;
+    while (node) {
+        next = node->next;
+        node->next = fifo;
+        fifo = node;
+        node = next;
+    }
+    while (fifo) {
+        next = fifo->next;
+        b_list_rpush(channel->queue, fifo);
+        fifo = next;
+    }
+    unsigned int moved = 0;
+    while (moved < max && (node = b_list_lpop(channel->queue))) {
+        if (!b_list_rpush(out, node)) {
+            // out refused it (a snapshot, or out of memory): keep it queued, first in line
+            b_list_lpush(channel->queue, node);
+            break;
+        }
+        ++moved;
+    }
+    if (channel->queue->size) channel_signal(channel);
+    return moved;
+}
+
+void b_free_list_channel(b_list_channel *channel) {
+    if (!channel) return;
+    b_list_node *node = __atomic_exchange_n(&channel->incoming, NULL, __ATOMIC_ACQUIRE);
+    b_list_node *next;
+    while (node) {
+        next = node->next;
+        b_list_rpush(channel->queue, node);
+        node = next;
+    }
+    b_free_list(channel->queue);
+    channel_close(channel);
+    free(channel);
+}
@@ -0,0 +1,36 @@
+#ifndef __B_LIST_CHANNEL__
+#define __B_LIST_CHANNEL__
+
+#include "b_list.h"
+
+typedef struct {
+    b_list *queue;
+    b_list_node *incoming;
+    int fds[2];
+} b_list_channel;
+
+/**
+ * Create a channel that queues nodes from any thread for a single consumer,
+ * typically an event loop. The free function releases data still queued when the channel is freed
+*/
+b_list_channel* b_new_list_channel(void (*free)(void *));
+
+/**
+ * File descriptor that becomes readable when nodes are waiting; register it for EPOLLIN
+*/
+int b_list_channel_fd(b_list_channel *channel);
+
+/**
+ * Enqueue a node without taking a lock. Safe to call from any thread
+*/
+b_list_node* b_list_channel_push(b_list_channel *channel, b_list_node *node);
+
+/**
+ * Move up to max queued nodes, oldest first, to the end of out. Never blocks.
+ * Consumer thread only. The fd stays readable while nodes are left behind
+*/
+unsigned int b_list_channel_drain(b_list_channel *channel, b_list *out, unsigned int max);
+
+void b_free_list_channel(b_list_channel *channel);
+
+#endif
@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "b_list.h"
+
+/*
+ * Differential harness: decodes a byte stream into list operations, runs them
+ * against b_list and a plain array model, and aborts on the first divergence.
+ * The first byte picks whether the list frees deleted data itself or leaves
+ * that to the harness (b_new_list).
+ * Built with -DB_LIST_LIBFUZZER it only exposes the libFuzzer entry point,
+ * otherwise main() feeds it pseudo-random streams.
+*/
+
+#define MODEL_CAPACITY 512
+#define MAX_SNAPSHOTS 2
+#define MAX_PARKED 4096
+
+#define check(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        abort(); \
+    } \
+} while (0)
+
+typedef struct {
+    b_list *list;
+    int values[MODEL_CAPACITY];
+    unsigned int size;
+} snapshot_model;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} byte_stream;
+
+static long live_values = 0;
+static int model[MODEL_CAPACITY];
+static unsigned int model_size;
+static snapshot_model snapshots[MAX_SNAPSHOTS];
+static void *parked[MAX_PARKED];
+static unsigned int parked_count;
+static int owns_data;
+
+static void value_free(void *data) {
+    --live_values;
+    free(data);
+}
+
+static int* new_value(int value) {
+    int *data = malloc(sizeof(int));
+    if (!data) abort();
+    *data = value;
+    ++live_values;
+    return data;
+}
+
+static int value_match(void *a, void *b) {
+    return *(int*)a == *(int*)b;
+}
+
+static int value_compare(void *a, void *b) {
+    return (*(int*)a > *(int*)b) - (*(int*)a < *(int*)b);
+}
+
+static int model_compare(const void *a, const void *b) {
+    return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b);
+}
+
+static uint8_t next_byte(byte_stream *in) {
+    if (!in->size) return 0;
+    --in->size;
+    return *in->data++;
+}
+
+static unsigned int snapshot_count() {
+    unsigned int count = 0;
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) count += snapshots[i].list != NULL;
+    return count;
+}
+
+static void release_node(b_list_node *node) {
+    value_free(node->data);
+    free(node);
+}
+
+/* Data the list no longer holds is ours to free, but older snapshots still read it until released */
+static void drop_data(void *data) {
+    if (!snapshot_count()) {
+        value_free(data);
+        return;
+    }
+    check(parked_count < MAX_PARKED);
+    parked[parked_count++] = data;
+}
+
+static void drop_node(b_list_node *node) {
+    drop_data(node->data);
+    free(node);
+}
+
+static void release_parked() {
+    while (parked_count) value_free(parked[--parked_count]);
+}
+
+static void model_insert(unsigned int index, int value) {
+    memmove(&model[index + 1], &model[index], (model_size - index) * sizeof(int));
+    model[index] = value;
+    ++model_size;
+}
+
+static void model_remove(unsigned int index) {
+    memmove(&model[index], &model[index + 1], (model_size - index - 1) * sizeof(int));
+    --model_size;
+}
+
+static void verify_list(b_list *list) {
+    check(list->size == model_size);
+    check(!list->head == !model_size);
+    check(!list->tail == !model_size);
+    if (list->head) check(list->head->prev == NULL);
+    if (list->tail) check(list->tail->next == NULL);
+    unsigned int i = 0;
+    b_list_node *prev = NULL;
+    b_list_node *node;
+    for (node = list->head; node; node = node->next) {
+        check(i < model_size);
+        check(node->prev == prev);
+        check(*(int*)node->data == model[i]);
+        prev = node;
+        i++;
+    }
+    check(i == model_size);
+    check(prev == list->tail);
+}
+
+static void verify_snapshot(snapshot_model *snap, b_list_iterator_direction direction) {
+    b_list_iterator *it = b_new_list_iterator(snap->list, direction);
+    check(it);
+    for (unsigned int i = 0; i < snap->size; i++) {
+        unsigned int index = direction == LIST_BEGIN ? i : snap->size - 1 - i;
+        b_list_node *node = b_list_iterator_next(it);
+        check(node);
+        check(*(int*)node->data == snap->values[index]);
+    }
+    check(b_list_iterator_next(it) == NULL);
+    b_free_list_iterator(it);
+    if (snap->size) {
+        int index = snap->size / 2;
+        check(*(int*)b_list_fetch(snap->list, index)->data == snap->values[index]);
+    }
+}
+
+/* Walk it, started at values[index], to the end of the list in direction */
+static void verify_walk(b_list_iterator *it, const int *values, unsigned int size, unsigned int index,
+                        b_list_iterator_direction direction) {
+    check(it);
+    unsigned int remaining = direction == LIST_BEGIN ? size - index : index + 1;
+    for (unsigned int i = 0; i < remaining; i++) {
+        b_list_node *node = b_list_iterator_next(it);
+        check(node);
+        check(*(int*)node->data == values[direction == LIST_BEGIN ? index + i : index - i]);
+    }
+    check(b_list_iterator_next(it) == NULL);
+    check(b_list_iterator_next(it) == NULL);
+    b_free_list_iterator(it);
+}
+
+static void run_op(b_list *list, byte_stream *in) {
+    uint8_t op = next_byte(in) % 16;
+    uint8_t arg = next_byte(in);
+    int value = arg % 32;
+    unsigned int index;
+    b_list_node *node;
+
+    switch (op) {
+    case 0:
+    case 1:
+        if (model_size == MODEL_CAPACITY) break;
+        node = b_new_list_node(new_value(value));
+        if (op == 0) {
+            check(b_list_lpush(list, node) == node);
+            model_insert(0, value);
+        } else {
+            check(b_list_rpush(list, node) == node);
+            model_insert(model_size, value);
+        }
+        break;
+    case 2:
+    case 3:
+        node = op == 2 ? b_list_lpop(list) : b_list_rpop(list);
+        if (!model_size) {
+            check(node == NULL);
+            break;
+        }
+        check(node && node->prev == NULL && node->next == NULL);
+        check(*(int*)node->data == model[op == 2 ? 0 : model_size - 1]);
+        model_remove(op == 2 ? 0 : model_size - 1);
+        drop_node(node);
+        break;
+    case 4:
+        if (model_size == MODEL_CAPACITY) break;
+        index = arg % (model_size + 2);
+        node = b_new_list_node(new_value(value));
+        if (index > model_size) {
+            check(b_list_insert(list, node, index) == NULL);
+            release_node(node);
+            break;
+        }
+        check(b_list_insert(list, node, index) == node);
+        model_insert(index, value);
+        break;
+    case 5:
+        index = arg % (model_size + 1);
+        node = b_list_fetch(list, index);
+        if (index == model_size) check(node == NULL);
+        else check(node && *(int*)node->data == model[index]);
+        check(b_list_fetch(list, -1) == NULL);
+        check(b_list_fetch(list, model_size + arg) == NULL);
+        check(b_list_fetch(NULL, 0) == NULL);
+        break;
+    case 6: {
+        node = b_list_find(list, value_match, &value);
+        unsigned int first = 0;
+        while (first < model_size && model[first] != value) first++;
+        if (first == model_size) check(node == NULL);
+        else check(node == b_list_fetch(list, first));
+        break;
+    }
+    case 7: {
+        if (!model_size) break;
+        index = arg % model_size;
+        node = b_list_fetch(list, index);
+        void *data = node->data;
+        b_list_delete(list, node);
+        if (!owns_data) drop_data(data);
+        model_remove(index);
+        break;
+    }
+    case 8: {
+        int at = (int)(arg % (model_size + 3)) - 1;
+        if (at < 0 || at >= (int)model_size) {
+            b_list_delete_at(list, at);
+            break;
+        }
+        void *data = b_list_fetch(list, at)->data;
+        b_list_delete_at(list, at);
+        if (!owns_data) drop_data(data);
+        model_remove(at);
+        break;
+    }
+    case 9:
+        b_list_sort(list, value_compare);
+        qsort(model, model_size, sizeof(int), model_compare);
+        break;
+    case 10: {
+        b_list_iterator_direction direction = arg & 1 ? LIST_END : LIST_BEGIN;
+        index = (arg >> 1) % (model_size + 1);
+        b_list_iterator *it = b_new_list_iterator_from_index(list, index, direction);
+        if (index == model_size) {
+            check(it == NULL);
+            break;
+        }
+        verify_walk(it, model, model_size, index, direction);
+        break;
+    }
+    case 11: {
+        snapshot_model *snap = &snapshots[arg % MAX_SNAPSHOTS];
+        if (snap->list) break;
+        snap->list = b_list_snapshot(list);
+        check(snap->list && snap->list->size == model_size);
+        memcpy(snap->values, model, model_size * sizeof(int));
+        snap->size = model_size;
+        break;
+    }
+    case 12: {
+        snapshot_model *snap = &snapshots[arg % MAX_SNAPSHOTS];
+        if (!snap->list) break;
+        if (arg & 8) {
+            b_list_delete(snap->list, snap->list->head); // snapshots are read-only
+            b_list_delete_at(snap->list, 0);
+        }
+        verify_snapshot(snap, arg & 2 ? LIST_END : LIST_BEGIN);
+        if (arg & 4) {
+            b_free_list(snap->list);
+            snap->list = NULL;
+            if (!snapshot_count()) release_parked();
+        }
+        break;
+    }
+    case 13:
+        check(b_list_defragment(list) == !snapshot_count());
+        break;
+    case 14:
+        check(b_new_list_iterator_from_index(list, -1, LIST_BEGIN) == NULL);
+        check(b_new_list_iterator_from_node(NULL, LIST_BEGIN) == NULL);
+        check(b_new_list_iterator_from_node_in(list, NULL, LIST_BEGIN) == NULL);
+        check(b_new_list_iterator_from_node_in(NULL, list->head, LIST_BEGIN) == NULL);
+        check(b_list_iterator_next(NULL) == NULL);
+        check(b_list_defragment(NULL) == 0);
+        b_list_delete(list, NULL);
+        b_list_delete(NULL, list->head);
+        b_list_delete_at(NULL, 0);
+        b_list_delete_at(list, -1 - arg);
+        break;
+    case 15: {
+        b_list_iterator_direction direction = arg & 1 ? LIST_END : LIST_BEGIN;
+        snapshot_model *snap = &snapshots[(arg >> 2) % MAX_SNAPSHOTS];
+        if (arg & 2 && snap->list) {
+            if (!snap->size) break;
+            index = (arg >> 3) % snap->size;
+            node = b_list_fetch(snap->list, index);
+            check(node);
+            verify_walk(b_new_list_iterator_from_node_in(snap->list, node, direction),
+                        snap->values, snap->size, index, direction);
+            break;
+        }
+        if (!model_size) break;
+        index = (arg >> 3) % model_size;
+        node = b_list_fetch(list, index);
+        check(node);
+        verify_walk(arg & 4 ? b_new_list_iterator_from_node(node, direction)
+                            : b_new_list_iterator_from_node_in(list, node, direction),
+                    model, model_size, index, direction);
+        break;
+    }
+    }
+}
+
+static void run(const uint8_t *data, size_t size) {
+    byte_stream in = {data, size};
+    owns_data = next_byte(&in) & 1;
+    b_list *list = owns_data ? b_new_list_with_func(value_free) : b_new_list();
+    if (!list) abort();
+    model_size = 0;
+    while (in.size) {
+        run_op(list, &in);
+        verify_list(list);
+    }
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (!snapshots[i].list) continue;
+        verify_snapshot(&snapshots[i], LIST_BEGIN);
+        b_free_list(snapshots[i].list);
+        snapshots[i].list = NULL;
+    }
+    release_parked();
+    void *remaining[MODEL_CAPACITY];
+    unsigned int count = 0;
+    for (b_list_node *node = list->head; node; node = node->next) remaining[count++] = node->data;
+    b_free_list(list);
+    if (!owns_data) while (count) value_free(remaining[--count]);
+    check(live_values == 0);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    run(data, size);
+    return 0;
+}
+
+#ifndef B_LIST_LIBFUZZER
+static uint64_t splitmix(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+int main(int argc, char **argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : 2000;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    static uint8_t buffer[8192];
+    for (int i = 0; i < runs; i++) {
+        uint64_t state = seed * 1000003 + i;
+        size_t size = splitmix(&state) % sizeof(buffer);
+        for (size_t j = 0; j < size; j++) buffer[j] = splitmix(&state);
+        run(buffer, size);
+    }
+    printf("%d runs ok\n", runs);
+    return 0;
+}
+#endif
@@ -2,8 +2,17 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #include "b_list.h"
+#include "b_list_channel.h"
 
 #define test(fn) \
     puts("... \x1b[33m" # fn "\x1b[0m"); \
@@ -326,6 +335,35 @@ static void test_b_new_list_iterator_from_node() {
     b_free_list(list);
 }
 
+static void test_b_new_list_iterator_from_node_in() {
+    b_list *list = b_new_list_with_func(dummy_free);
+    for (int i = 0; i < 5; i++) {
+        int *value = malloc(sizeof(int));
+        *value = i;
+        b_list_rpush(list, b_new_list_node(value));
+    }
+    b_list *snap = b_list_snapshot(list);
+    b_list_node *node = b_list_fetch(snap, 1);
+    b_list_delete_at(list, 1);
+    b_list_delete_at(list, 1);
+    b_list_iterator *it = b_new_list_iterator_from_node_in(snap, node, LIST_BEGIN);
+    for (int i = 1; i < 5; i++) assert(*(int*)(b_list_iterator_next(it)->data) == i);
+    assert(b_list_iterator_next(it) == NULL);
+    b_list_iterator *it1 = b_new_list_iterator_from_node_in(snap, b_list_fetch(snap, 3), LIST_END);
+    for (int i = 3; i >= 0; i--) assert(*(int*)(b_list_iterator_next(it1)->data) == i);
+    assert(b_list_iterator_next(it1) == NULL);
+    b_list_iterator *it2 = b_new_list_iterator_from_node_in(list, list->head, LIST_BEGIN);
+    assert(*(int*)(b_list_iterator_next(it2)->data) == 0);
+    assert(*(int*)(b_list_iterator_next(it2)->data) == 3);
+    assert(it2->view == NULL);
+
+    b_free_list_iterator(it);
+    b_free_list_iterator(it1);
+    b_free_list_iterator(it2);
+    b_free_list(snap);
+    b_free_list(list);
+}
+
 static void test_b_new_list_iterator_from_index() {
     b_list *list = b_new_list();
     b_list_node *node = b_new_list_node("a");
@@ -361,6 +399,7 @@ static void test_b_list_iterator_next() {
     assert(b_list_iterator_next(it) == node); 
     assert(b_list_iterator_next(it) == node1); 
     assert(b_list_iterator_next(it) == node2); 
+    assert(b_list_iterator_next(it) == NULL); // past the end
     b_list_iterator *it1 = b_new_list_iterator(list, LIST_END);
     assert(b_list_iterator_next(it1) == node2); 
     assert(b_list_iterator_next(it1) == node1); 
@@ -402,6 +441,288 @@ static void test_b_list_sort() {
     b_free_list(list);
 }
 
+static void test_b_list_snapshot() {
+    b_list *list = b_new_list_with_func(dummy_free);
+    int *values[5];
+    for (int i = 0; i < 5; i++) {
+        values[i] = malloc(sizeof(int));
+        *values[i] = i;
+        b_list_rpush(list, b_new_list_node(values[i]));
+    }
+    b_list *snap = b_list_snapshot(list);
+    assert(snap->size == 5);
+    assert(snap->head == list->head);
+    assert(snap->tail == list->tail);
+    b_list_node *node = b_new_list_node(NULL);
+    assert(b_list_rpush(snap, node) == NULL); // snapshots are read-only
+    free(node);
+
+    free_calls = 0;
+    b_list_delete_at(list, 2);
+    b_list_delete(list, list->head);
+    int *extra = malloc(sizeof(int));
+    *extra = 10;
+    b_list_insert(list, b_new_list_node(extra), 1);
+    b_list_sort(list, compare);
+    assert(free_calls == 0);
+    assert(list->size == 4);
+
+    b_list *snap1 = b_list_snapshot(list);
+    b_list_delete(list, list->tail);
+    b_list_iterator *it = b_new_list_iterator(snap, LIST_BEGIN);
+    b_list_iterator *it1 = b_new_list_iterator(snap, LIST_END);
+    for (int i = 0; i < 5; i++) {
+        assert(*(int*)(b_list_iterator_next(it)->data) == i);
+        assert(*(int*)(b_list_iterator_next(it1)->data) == 4 - i);
+    }
+    assert(it->next == NULL);
+    assert(it1->next == NULL);
+    assert(*(int*)(b_list_fetch(snap, 3)->data) == 3);
+    b_list_iterator *it2 = b_new_list_iterator_from_index(snap, 2, LIST_BEGIN);
+    assert(*(int*)(b_list_iterator_next(it2)->data) == 2);
+    int expected[4] = {1, 3, 4, 10};
+    b_list_iterator *it3 = b_new_list_iterator(snap1, LIST_BEGIN);
+    for (int i = 0; i < 4; i++) assert(*(int*)(b_list_iterator_next(it3)->data) == expected[i]);
+    assert(it3->next == NULL);
+    assert(list->size == 3);
+    assert(*(int*)(list->tail->data) == 4);
+
+    b_free_list(snap);
+    assert(free_calls == 2); // deleted before snap1 was taken
+    b_free_list(snap1);
+    assert(free_calls == 3);
+    b_free_list_iterator(it);
+    b_free_list_iterator(it1);
+    b_free_list_iterator(it2);
+    b_free_list_iterator(it3);
+
+    b_list *snap3 = b_list_snapshot(list);
+    node = b_list_lpop(list);
+    assert(node != snap3->head); // the snapshot keeps the original
+    assert(*(int*)node->data == 1);
+    b_list_rpush(list, node);
+    node = b_list_rpop(list);
+    free(node); // popped nodes can be freed while snapshots are alive
+    assert(b_list_lpop(snap3) == NULL); // snapshots are read-only
+    it = b_new_list_iterator(snap3, LIST_BEGIN);
+    for (int i = 0; i < 3; i++) assert(*(int*)(b_list_iterator_next(it)->data) == expected[i]);
+    assert(b_list_iterator_next(it) == NULL);
+    b_free_list_iterator(it);
+    b_free_list(snap3);
+    b_list_lpush(list, b_new_list_node(values[1]));
+
+    b_list *snap2 = b_list_snapshot(list);
+    b_free_list(list); // snapshot outlives the live list
+    assert(free_calls == 3);
+    assert(*(int*)(b_list_fetch(snap2, 2)->data) == 4);
+    b_free_list(snap2);
+    assert(free_calls == 6);
+}
+
+static void test_b_list_defragment() {
+    b_list *list = b_new_list_with_func(dummy_free);
+    for (int i = 0; i < 100; i++) {
+        int *value = malloc(sizeof(int));
+        *value = i;
+        b_list_insert(list, b_new_list_node(value), (i * 7) % (i + 1));
+    }
+    for (int i = 0; i < 30; i++) b_list_delete_at(list, (i * 13) % list->size);
+    int order[70];
+    int i = 0;
+    b_list_node *node;
+    for (node = list->head; node; node = node->next) order[i++] = *(int*)node->data;
+    assert(i == 70);
+
+    assert(b_list_defragment(list) == 1);
+    assert(list->size == 70);
+    assert(list->head->prev == NULL);
+    assert(list->tail->next == NULL);
+    i = 0;
+    for (node = list->head; node; node = node->next) {
+        assert(*(int*)node->data == order[i]);
+        if (node->next) assert(node->next == node + 1);
+        if (node->prev) assert(node->prev->next == node);
+        i++;
+    }
+    b_list_iterator *it = b_new_list_iterator(list, LIST_END);
+    for (i = 69; i >= 0; i--) assert(*(int*)(b_list_iterator_next(it)->data) == order[i]);
+
+    free_calls = 0;
+    b_list_delete_at(list, 10);
+    b_list_node *tail = list->tail;
+    node = b_list_rpop(list);
+    assert(node != tail); // chunked nodes are handed out as heap copies
+    assert(*(int*)node->data == order[69]);
+    dummy_free(node->data);
+    free(node);
+    b_list_rpush(list, b_new_list_node(malloc(sizeof(int))));
+    assert(b_list_defragment(list) == 1); // again, over a partly freed block
+    assert(list->size == 69);
+
+    b_list *snap = b_list_snapshot(list);
+    assert(b_list_defragment(list) == 0);
+    assert(b_list_defragment(snap) == 0);
+    assert(b_list_defragment(NULL) == 0);
+    b_free_list(snap);
+
+    b_free_list_iterator(it);
+    b_free_list(list);
+    assert(free_calls == 71);
+
+    list = b_new_list_with_func(dummy_free);
+    for (i = 0; i < 600; i++) {
+        int *value = malloc(sizeof(int));
+        *value = i;
+        b_list_rpush(list, b_new_list_node(value));
+    }
+    assert(b_list_defragment(list) == 1);
+    for (i = 0, node = list->head; node->next; node = node->next, i++) {
+        if ((i + 1) % 256) assert(node->next == node + 1); // chunks of 256 nodes
+    }
+    for (i = 0; i < 590; i++) {
+        node = b_list_lpop(list);
+        assert(*(int*)node->data == i);
+        dummy_free(node->data);
+        free(node);
+    }
+    assert(*(int*)list->head->data == 590);
+    b_free_list(list);
+}
+
+#define CHANNEL_MESSAGES 10000
+
+static void* channel_producer(void *arg) {
+    b_list_channel *channel = arg;
+    for (int i = 0; i < CHANNEL_MESSAGES; i++) {
+        int *value = malloc(sizeof(int));
+        *value = i;
+        b_list_channel_push(channel, b_new_list_node(value));
+    }
+    return NULL;
+}
+
+static void test_b_list_channel() {
+    b_list_channel *channel = b_new_list_channel(dummy_free);
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    struct pollfd fds[2] = {
+        {.fd = b_list_channel_fd(channel), .events = POLLIN},
+        {.fd = sv[1], .events = POLLIN}
+    };
+    assert(poll(fds, 2, 0) == 0); // nothing queued yet
+
+    pthread_t producer;
+    assert(pthread_create(&producer, NULL, channel_producer, channel) == 0);
+    b_list *batch = b_new_list_with_func(dummy_free);
+    int sent = 0;
+    int received = 0;
+    free_calls = 0;
+    while (received < CHANNEL_MESSAGES) {
+        assert(poll(fds, 2, 1000) > 0);
+        if (fds[1].revents & POLLIN) {
+            int values[64];
+            ssize_t len = read(sv[1], values, sizeof(values));
+            assert(len > 0 && len % sizeof(int) == 0);
+            for (int j = 0; j < len / (ssize_t)sizeof(int); j++) assert(values[j] == received++);
+        }
+        if (fds[0].revents & POLLIN) {
+            assert(b_list_channel_drain(channel, batch, 64) <= 64);
+            b_list_node *node;
+            while ((node = b_list_lpop(batch))) {
+                assert(write(sv[0], node->data, sizeof(int)) == sizeof(int));
+                ++sent;
+                dummy_free(node->data);
+                free(node);
+            }
+        }
+    }
+    pthread_join(producer, NULL);
+    assert(sent == CHANNEL_MESSAGES);
+    assert(free_calls == CHANNEL_MESSAGES);
+    assert(b_list_channel_drain(channel, batch, 64) == 0);
+    assert(poll(fds, 2, 0) == 0); // drained and delivered
+
+    for (int i = 0; i < 3; i++) {
+        int *value = malloc(sizeof(int));
+        *value = i;
+        b_list_channel_push(channel, b_new_list_node(value));
+    }
+    assert(b_list_channel_drain(channel, batch, 2) == 2);
+    assert(*(int*)batch->head->data == 0);
+    assert(*(int*)batch->tail->data == 1);
+    assert(poll(fds, 2, 0) == 1 && fds[0].revents & POLLIN); // a node is still waiting
+    b_list *snap = b_list_snapshot(batch);
+    assert(b_list_channel_drain(channel, snap, 2) == 0); // snapshots are read-only
+    b_free_list(snap);
+    assert(b_list_channel_drain(channel, batch, 2) == 1);
+    assert(*(int*)batch->tail->data == 2);
+    b_list_channel_push(channel, b_new_list_node(malloc(sizeof(int))));
+
+    b_free_list_channel(channel);
+    b_free_list(batch);
+    assert(free_calls == CHANNEL_MESSAGES + 4);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+#ifdef __linux__
+static void test_b_list_channel_epoll() {
+    b_list_channel *channel = b_new_list_channel(dummy_free);
+    b_list *batch = b_new_list_with_func(dummy_free);
+    int epfd = epoll_create1(0);
+    assert(epfd >= 0);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = b_list_channel_fd(channel)};
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) == 0);
+    struct epoll_event events[1];
+    assert(epoll_wait(epfd, events, 1, 0) == 0);
+
+    free_calls = 0;
+    b_list_channel_push(channel, b_new_list_node(malloc(sizeof(int))));
+    b_list_channel_push(channel, b_new_list_node(malloc(sizeof(int))));
+    assert(epoll_wait(epfd, events, 1, 0) == 1);
+    assert(events[0].data.fd == b_list_channel_fd(channel));
+    assert(b_list_channel_drain(channel, batch, 64) == 2);
+    assert(epoll_wait(epfd, events, 1, 0) == 0);
+
+    b_free_list_channel(channel);
+    b_free_list(batch);
+    assert(free_calls == 2);
+    close(epfd);
+}
+#endif
+
+static void test_b_list_snapshot_overlap() {
+    b_list *list = b_new_list_with_func(dummy_free);
+    for (int i = 0; i < 10; i++) {
+        int *value = malloc(sizeof(int));
+        *value = i;
+        b_list_rpush(list, b_new_list_node(value));
+    }
+    free_calls = 0;
+    b_list *snap = b_list_snapshot(list);
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < 100; i++) {
+            b_list_delete(list, list->head);
+            int *value = malloc(sizeof(int));
+            *value = round * 100 + i;
+            b_list_rpush(list, b_new_list_node(value));
+        }
+        b_list *next = b_list_snapshot(list); // taken before the old one is released
+        int calls = free_calls;
+        b_free_list(snap);
+        snap = next;
+        assert(free_calls == calls + 100); // dropped nodes go as soon as no snapshot can reach them
+        b_list_iterator *it = b_new_list_iterator(snap, LIST_BEGIN);
+        for (int i = 90; i < 100; i++) assert(*(int*)(b_list_iterator_next(it)->data) == round * 100 + i);
+        assert(b_list_iterator_next(it) == NULL);
+        b_free_list_iterator(it);
+    }
+    assert(free_calls == 500);
+    b_free_list(snap);
+    b_free_list(list);
+    assert(free_calls == 510);
+}
+
 int main() {
     test(b_new_list_node);
     test(b_new_list);
@@ -417,7 +738,15 @@ int main() {
     test(b_list_delete_at);
     test(b_new_list_iterator);
     test(b_new_list_iterator_from_node);
+    test(b_new_list_iterator_from_node_in);
     test(b_new_list_iterator_from_index);
     test(b_list_iterator_next);
     test(b_list_sort);
+    test(b_list_snapshot);
+    test(b_list_snapshot_overlap);
+    test(b_list_defragment);
+    test(b_list_channel);
+#ifdef __linux__
+    test(b_list_channel_epoll);
+#endif
 }
\ No newline at end of file